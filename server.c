@@ -1,6 +1,7 @@
 // Course Registration Portal (Academia) Mini Project
 // Kunal Mittal (IMT2023533)
 
+#define _GNU_SOURCE     // ppoll
 #include <stdio.h>      // only for snprintf, perror
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,12 @@
 #include <arpa/inet.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <poll.h>
 
 // Add this include for sleep function
 #include <time.h>
@@ -23,10 +30,34 @@
 // Add a sleep duration in seconds
 #define COURSE_ADD_DELAY 20
 
+// Password hashing pool (scrypt, run in dedicated worker processes)
+#define HASH_WORKERS     2
+#define HASH_QUEUE_MAX  16      // jobs beyond this are rejected as "busy"
+#define HASH_TIMEOUT_MS 3000    // per-request wait limit for a session
+#define SCRYPT_LOG_N    14      // N = 2^14, r = 8 -> 16 MiB per hash
+#define SCRYPT_R         8
+#define SCRYPT_P         1
+#define SALT_LEN        16
+#define DK_LEN          32
+#define PWD_MAX         64      // longer passwords are pre-hashed with SHA-256
+
+// Seat-availability subscriptions (shared by all session processes)
+#define MAX_WATCHES    256
+#define CID_MAX         32
+
+// Admin batch transactions
+#define BATCH_MAX     1024
+
+// Timetable index (shared by all session processes)
+#define TT_STUDENTS   1024
+#define TT_SLOTS        48      // booked meeting slots per student
+#define SLOTS_MAX        8      // meeting slots per course
+
 const char *STUD_FILE = "data/students.txt";
 const char *FAC_FILE  = "data/faculty.txt";
 const char *CRS_FILE  = "data/courses.txt";
 const char *ENR_FILE  = "data/enrollments.txt";
+const char *LOCK_FILE = "data/.lock";
 
 // Acquire a blocking fcntl lock
 int lock_fd(int fd, short type) {
@@ -34,15 +65,51 @@ int lock_fd(int fd, short type) {
     return fcntl(fd, F_SETLKW, &fl);
 }
 
+// Exclusive writer lock over all data files, held across a whole
+// read-validate-rename sequence. fcntl locks belong to the process and are
+// dropped by any close() of the file, so nested callers share one fd.
+static int data_lock_fd = -1, data_lock_depth = 0;
+
+void lock_data(void) {
+    if (data_lock_depth++) return;
+    data_lock_fd = open(LOCK_FILE, O_RDWR|O_CREAT, 0644);
+    if (data_lock_fd >= 0) lock_fd(data_lock_fd, F_WRLCK);
+}
+
+void unlock_data(void) {
+    if (--data_lock_depth) return;
+    if (data_lock_fd >= 0) close(data_lock_fd);
+    data_lock_fd = -1;
+}
+
 // Send a C-string to the client
 void send_str(int cfd, const char *s) {
     write(cfd, s, strlen(s));
 }
 
-// Read one line (including '\n') from client
+void flush_notifications(int cfd);
+void end_session(int cfd);
+extern sigset_t watch_waitmask;
+
+// Read one line (including '\n') from client. SIGUSR1 (a watch update) is
+// only unblocked inside ppoll, so pending notices are pushed while we idle.
+// Notices are flushed on entry and after each wakeup, not per byte.
+// A closed connection ends the session; a final unterminated line is
+// returned first.
 ssize_t read_line(int cfd, char *buf, size_t max) {
     ssize_t n = 0; char ch;
-    while (n + 1 < (ssize_t)max && read(cfd, &ch, 1) == 1) {
+    struct pollfd pfd = { .fd = cfd, .events = POLLIN };
+    flush_notifications(cfd);
+    while (n + 1 < (ssize_t)max) {
+        if (ppoll(&pfd, 1, NULL, &watch_waitmask) < 0) {
+            if (errno == EINTR) { flush_notifications(cfd); continue; }
+            if (!n) end_session(cfd);
+            break;
+        }
+        if (read(cfd, &ch, 1) != 1) {
+            if (!n) end_session(cfd);
+            break;
+        }
         buf[n++] = ch;
         if (ch == '\n') break;
     }
@@ -60,21 +127,24 @@ void trim(char *s) {
 
 // 1) Append a line under exclusive lock (syscalls only)
 void append_line_sys(const char *file, const char *line) {
+    lock_data();
     int fd = open(file, O_WRONLY|O_APPEND);
-    if (fd<0) return;
+    if (fd<0) { unlock_data(); return; }
     lock_fd(fd, F_WRLCK);
     write(fd, line, strlen(line));
     write(fd, "\n", 1);
     close(fd);
+    unlock_data();
 }
 
 // 2) Replace or delete a single line matching prefix: (syscalls only)
-void rewrite_single_line_sys(const char *file,
-                             const char *prefix,
-                             const char *newline,
-                             int cfd) {
+// Returns 1 if the line was found and replaced, 0 otherwise.
+static int rewrite_single_line_locked(const char *file,
+                                      const char *prefix,
+                                      const char *newline,
+                                      int cfd) {
     int fd_in = open(file, O_RDONLY);
-    if (fd_in<0) { send_str(cfd,"Open error\n"); return; }
+    if (fd_in<0) { send_str(cfd,"Open error\n"); return 0; }
 
     char tmp[] = "/tmp/rwXXXXXX";
     int fd_tmp = mkstemp(tmp);
@@ -82,7 +152,7 @@ void rewrite_single_line_sys(const char *file,
         perror("mkstemp failed");
         close(fd_in);  // Fix 1: Changed 'in' to 'fd_in'
         send_str(cfd, "Error creating temporary file.\n");
-        return;  // Fix 2: Changed 'continue' to 'return' since we're not in a loop
+        return 0;  // Fix 2: Changed 'continue' to 'return' since we're not in a loop
     }
 
     lock_fd(fd_in,  F_RDLCK);
@@ -129,9 +199,20 @@ void rewrite_single_line_sys(const char *file,
     if (!found) {
         send_str(cfd,"Not found\n");
         unlink(tmp);
-        return;
+        return 0;
     }
     rename(tmp, file);
+    return 1;
+}
+
+int rewrite_single_line_sys(const char *file,
+                            const char *prefix,
+                            const char *newline,
+                            int cfd) {
+    lock_data();
+    int rc = rewrite_single_line_locked(file, prefix, newline, cfd);
+    unlock_data();
+    return rc;
 }
 
 // 3) Count students in course cid (syscalls only)
@@ -189,25 +270,515 @@ int read_file_lines_sys(const char *file,
     return 0;
 }
 
+// ---------------------------------------------------------------------------
+// Password hashing: scrypt (SHA-256 / PBKDF2 / Salsa20/8), self-contained
+// ---------------------------------------------------------------------------
+
+typedef struct { uint32_t s[8]; uint64_t bits; uint8_t buf[64]; size_t n; } sha256_ctx;
+
+static const uint32_t K256[64] = {
+    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define ROR32(x,n) (((x)>>(n))|((x)<<(32-(n))))
+#define ROL32(x,n) (((x)<<(n))|((x)>>(32-(n))))
+
+static void sha256_block(sha256_ctx *c, const uint8_t *p) {
+    uint32_t w[64], a,b,d,e,f,g,h,cc,t1,t2;
+    for (int i=0;i<16;i++)
+        w[i] = (uint32_t)p[4*i]<<24 | (uint32_t)p[4*i+1]<<16 | (uint32_t)p[4*i+2]<<8 | p[4*i+3];
+    for (int i=16;i<64;i++) {
+        uint32_t s0 = ROR32(w[i-15],7) ^ ROR32(w[i-15],18) ^ (w[i-15]>>3);
+        uint32_t s1 = ROR32(w[i-2],17) ^ ROR32(w[i-2],19)  ^ (w[i-2]>>10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    a=c->s[0]; b=c->s[1]; cc=c->s[2]; d=c->s[3]; e=c->s[4]; f=c->s[5]; g=c->s[6]; h=c->s[7];
+    for (int i=0;i<64;i++) {
+        t1 = h + (ROR32(e,6)^ROR32(e,11)^ROR32(e,25)) + ((e&f)^(~e&g)) + K256[i] + w[i];
+        t2 = (ROR32(a,2)^ROR32(a,13)^ROR32(a,22)) + ((a&b)^(a&cc)^(b&cc));
+        h=g; g=f; f=e; e=d+t1; d=cc; cc=b; b=a; a=t1+t2;
+    }
+    c->s[0]+=a; c->s[1]+=b; c->s[2]+=cc; c->s[3]+=d; c->s[4]+=e; c->s[5]+=f; c->s[6]+=g; c->s[7]+=h;
+}
+
+static void sha256_init(sha256_ctx *c) {
+    static const uint32_t iv[8] = {
+        0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19 };
+    memcpy(c->s, iv, sizeof(iv));
+    c->bits = 0; c->n = 0;
+}
+
+static void sha256_update(sha256_ctx *c, const void *data, size_t len) {
+    const uint8_t *p = data;
+    c->bits += (uint64_t)len * 8;
+    while (len) {
+        size_t k = 64 - c->n < len ? 64 - c->n : len;
+        memcpy(c->buf + c->n, p, k);
+        c->n += k; p += k; len -= k;
+        if (c->n == 64) { sha256_block(c, c->buf); c->n = 0; }
+    }
+}
+
+static void sha256_final(sha256_ctx *c, uint8_t out[32]) {
+    uint64_t bits = c->bits;
+    uint8_t pad = 0x80, zero = 0, lenb[8];
+    sha256_update(c, &pad, 1);
+    while (c->n != 56) sha256_update(c, &zero, 1);
+    for (int i=0;i<8;i++) lenb[i] = (uint8_t)(bits >> (56 - 8*i));
+    sha256_update(c, lenb, 8);
+    for (int i=0;i<8;i++) {
+        out[4*i]   = c->s[i]>>24; out[4*i+1] = c->s[i]>>16;
+        out[4*i+2] = c->s[i]>>8;  out[4*i+3] = c->s[i];
+    }
+}
+
+// PBKDF2-HMAC-SHA256 (RFC 8018)
+static void pbkdf2_sha256(const uint8_t *pw, size_t pwlen,
+                          const uint8_t *salt, size_t slen,
+                          uint32_t iters, uint8_t *out, size_t outlen) {
+    uint8_t key[64] = {0}, pad[64];
+    sha256_ctx ictx, octx, h;
+    if (pwlen > 64) { sha256_init(&h); sha256_update(&h, pw, pwlen); sha256_final(&h, key); }
+    else memcpy(key, pw, pwlen);
+    for (int i=0;i<64;i++) pad[i] = key[i]^0x36;
+    sha256_init(&ictx); sha256_update(&ictx, pad, 64);
+    for (int i=0;i<64;i++) pad[i] = key[i]^0x5c;
+    sha256_init(&octx); sha256_update(&octx, pad, 64);
+
+    for (uint32_t blk = 1; outlen; blk++) {
+        uint8_t cnt[4] = { blk>>24, blk>>16, blk>>8, blk }, u[32], t[32];
+        h = ictx; sha256_update(&h, salt, slen); sha256_update(&h, cnt, 4); sha256_final(&h, u);
+        h = octx; sha256_update(&h, u, 32); sha256_final(&h, u);
+        memcpy(t, u, 32);
+        for (uint32_t j = 1; j < iters; j++) {
+            h = ictx; sha256_update(&h, u, 32); sha256_final(&h, u);
+            h = octx; sha256_update(&h, u, 32); sha256_final(&h, u);
+            for (int k=0;k<32;k++) t[k] ^= u[k];
+        }
+        size_t n = outlen < 32 ? outlen : 32;
+        memcpy(out, t, n);
+        out += n; outlen -= n;
+    }
+}
+
+static void salsa20_8(uint32_t B[16]) {
+    uint32_t x[16];
+    memcpy(x, B, 64);
+    for (int i=0;i<8;i+=2) {
+        x[ 4]^=ROL32(x[ 0]+x[12], 7); x[ 8]^=ROL32(x[ 4]+x[ 0], 9);
+        x[12]^=ROL32(x[ 8]+x[ 4],13); x[ 0]^=ROL32(x[12]+x[ 8],18);
+        x[ 9]^=ROL32(x[ 5]+x[ 1], 7); x[13]^=ROL32(x[ 9]+x[ 5], 9);
+        x[ 1]^=ROL32(x[13]+x[ 9],13); x[ 5]^=ROL32(x[ 1]+x[13],18);
+        x[14]^=ROL32(x[10]+x[ 6], 7); x[ 2]^=ROL32(x[14]+x[10], 9);
+        x[ 6]^=ROL32(x[ 2]+x[14],13); x[10]^=ROL32(x[ 6]+x[ 2],18);
+        x[ 3]^=ROL32(x[15]+x[11], 7); x[ 7]^=ROL32(x[ 3]+x[15], 9);
+        x[11]^=ROL32(x[ 7]+x[ 3],13); x[15]^=ROL32(x[11]+x[ 7],18);
+        x[ 1]^=ROL32(x[ 0]+x[ 3], 7); x[ 2]^=ROL32(x[ 1]+x[ 0], 9);
+        x[ 3]^=ROL32(x[ 2]+x[ 1],13); x[ 0]^=ROL32(x[ 3]+x[ 2],18);
+        x[ 6]^=ROL32(x[ 5]+x[ 4], 7); x[ 7]^=ROL32(x[ 6]+x[ 5], 9);
+        x[ 4]^=ROL32(x[ 7]+x[ 6],13); x[ 5]^=ROL32(x[ 4]+x[ 7],18);
+        x[11]^=ROL32(x[10]+x[ 9], 7); x[ 8]^=ROL32(x[11]+x[10], 9);
+        x[ 9]^=ROL32(x[ 8]+x[11],13); x[10]^=ROL32(x[ 9]+x[ 8],18);
+        x[12]^=ROL32(x[15]+x[14], 7); x[13]^=ROL32(x[12]+x[15], 9);
+        x[14]^=ROL32(x[13]+x[12],13); x[15]^=ROL32(x[14]+x[13],18);
+    }
+    for (int i=0;i<16;i++) B[i] += x[i];
+}
+
+static void blockmix(uint32_t *B, uint32_t *Y, int r) {
+    uint32_t X[16];
+    memcpy(X, &B[(2*r-1)*16], 64);
+    for (int i=0;i<2*r;i++) {
+        for (int k=0;k<16;k++) X[k] ^= B[i*16+k];
+        salsa20_8(X);
+        memcpy(&Y[i*16], X, 64);
+    }
+    for (int i=0;i<r;i++) memcpy(&B[i*16],     &Y[(2*i)*16],   64);
+    for (int i=0;i<r;i++) memcpy(&B[(i+r)*16], &Y[(2*i+1)*16], 64);
+}
+
+static void romix(uint8_t *B, int r, uint32_t N, uint32_t *V, uint32_t *X, uint32_t *Y) {
+    size_t words = 32 * (size_t)r;
+    for (size_t k=0;k<words;k++)
+        X[k] = (uint32_t)B[4*k] | (uint32_t)B[4*k+1]<<8 | (uint32_t)B[4*k+2]<<16 | (uint32_t)B[4*k+3]<<24;
+    for (uint32_t i=0;i<N;i++) {
+        memcpy(&V[i*words], X, words*4);
+        blockmix(X, Y, r);
+    }
+    for (uint32_t i=0;i<N;i++) {
+        uint32_t j = X[(2*r-1)*16] & (N-1);
+        for (size_t k=0;k<words;k++) X[k] ^= V[j*words+k];
+        blockmix(X, Y, r);
+    }
+    for (size_t k=0;k<words;k++) {
+        B[4*k] = X[k]; B[4*k+1] = X[k]>>8; B[4*k+2] = X[k]>>16; B[4*k+3] = X[k]>>24;
+    }
+}
+
+// scrypt (RFC 7914). Returns 0 on success, -1 on bad params / no memory.
+int scrypt_kdf(const uint8_t *pw, size_t pwlen, const uint8_t *salt, size_t slen,
+               int logn, int r, int p, uint8_t *out, size_t outlen) {
+    if (logn < 1 || logn > 20 || r < 1 || r > 32 || p < 1 || p > 16) return -1;
+    uint32_t N = 1u << logn;
+    size_t blen = 128 * (size_t)r;
+    uint8_t  *B = malloc(blen * p);
+    uint32_t *V = malloc(blen * N);
+    uint32_t *X = malloc(blen), *Y = malloc(blen);
+    int rc = -1;
+    if (B && V && X && Y) {
+        pbkdf2_sha256(pw, pwlen, salt, slen, 1, B, blen * p);
+        for (int i=0;i<p;i++) romix(B + i*blen, r, N, V, X, Y);
+        pbkdf2_sha256(pw, pwlen, B, blen * p, 1, out, outlen);
+        rc = 0;
+    }
+    free(B); free(V); free(X); free(Y);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Hashing worker pool. Jobs live in a MAP_SHARED region set up before fork(),
+// so every session process can enqueue and every worker can dequeue.
+// ---------------------------------------------------------------------------
+
+enum { JOB_FREE, JOB_PENDING, JOB_RUNNING, JOB_DONE, JOB_ABANDONED };
+
+typedef struct {
+    sem_t   done;                 // posted by the worker when dk is ready
+    int     state;                // JOB_*; changed only with CAS
+    int     logn, r, p;
+    uint8_t pwd[PWD_MAX];
+    size_t  pwlen;
+    uint8_t salt[SALT_LEN];
+    uint8_t dk[DK_LEN];
+    int     failed;
+    long    enq_us;
+} hash_job;
+
+typedef struct {
+    sem_t    lock;                // guards ring/head/tail
+    sem_t    items;               // queued jobs
+    sem_t    slots;               // free job slots (bounds the queue)
+    int      ring[HASH_QUEUE_MAX];
+    int      head, tail;
+    hash_job job[HASH_QUEUE_MAX];
+    pid_t    worker[HASH_WORKERS];
+    int      cur[HASH_WORKERS];   // job a worker has dequeued and not finished, or -1
+    // metrics
+    long     depth, submitted, completed, rejected, timeouts, restarts;
+    long     wait_us_total, hash_us_total, hash_us_max;
+} hash_pool;
+
+static hash_pool *hpool;
+
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static int job_cas(hash_job *j, int from, int to) {
+    return __atomic_compare_exchange_n(&j->state, &from, to, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void job_release(int idx) {
+    __atomic_store_n(&hpool->job[idx].state, JOB_FREE, __ATOMIC_RELEASE);
+    sem_post(&hpool->slots);
+}
+
+// Worker w. While cur[w] names a job, only this worker can finish or free
+// it, so if the worker dies the parent can settle it (hash_worker_exited).
+static void hash_worker_loop(int w) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    while (1) {
+        if (sem_wait(&hpool->items) < 0) continue;
+        sem_wait(&hpool->lock);
+        int idx = hpool->ring[hpool->head];
+        hpool->head = (hpool->head + 1) % HASH_QUEUE_MAX;
+        __atomic_store_n(&hpool->cur[w], idx, __ATOMIC_RELEASE);
+        sem_post(&hpool->lock);
+        __atomic_sub_fetch(&hpool->depth, 1, __ATOMIC_RELAXED);
+
+        hash_job *j = &hpool->job[idx];
+        // Session already gave up: skip the work entirely
+        if (!job_cas(j, JOB_PENDING, JOB_RUNNING)) {
+            __atomic_store_n(&hpool->cur[w], -1, __ATOMIC_RELEASE);
+            job_release(idx);
+            continue;
+        }
+
+        long t0 = now_us();
+        j->failed = scrypt_kdf(j->pwd, j->pwlen, j->salt, SALT_LEN, j->logn, j->r, j->p, j->dk, DK_LEN) < 0;
+        long t1 = now_us();
+        memset(j->pwd, 0, sizeof(j->pwd));
+
+        long dt = t1 - t0, prev;
+        __atomic_add_fetch(&hpool->completed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hpool->wait_us_total, t0 - j->enq_us, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hpool->hash_us_total, dt, __ATOMIC_RELAXED);
+        prev = __atomic_load_n(&hpool->hash_us_max, __ATOMIC_RELAXED);
+        while (dt > prev && !__atomic_compare_exchange_n(&hpool->hash_us_max, &prev, dt, 0,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        __atomic_store_n(&hpool->cur[w], -1, __ATOMIC_RELEASE);
+        if (job_cas(j, JOB_RUNNING, JOB_DONE)) sem_post(&j->done);
+        else job_release(idx);  // abandoned while running
+    }
+}
+
+static int hash_spawn(int w, int listen_fd) {
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return -1; }
+    if (pid == 0) {
+        if (listen_fd >= 0) close(listen_fd);
+        hash_worker_loop(w);
+    }
+    hpool->worker[w] = pid;
+    return 0;
+}
+
+// Called by the parent for every reaped child. If it was a hash worker,
+// settle the job it held and fork a replacement. Without this a worker
+// killed mid-job (e.g. by the OOM killer) would pin its slot for good and
+// the pool would shrink until every login reported busy.
+void hash_worker_exited(pid_t pid, int listen_fd) {
+    if (!hpool) return;
+    for (int w=0;w<HASH_WORKERS;w++) {
+        if (hpool->worker[w] != pid) continue;
+        int idx = __atomic_exchange_n(&hpool->cur[w], -1, __ATOMIC_ACQ_REL);
+        if (idx >= 0) {
+            hash_job *j = &hpool->job[idx];
+            int st = __atomic_load_n(&j->state, __ATOMIC_ACQUIRE);
+            if (st == JOB_PENDING || st == JOB_RUNNING) {
+                j->failed = 1;   // session reads it only after JOB_DONE
+                if (job_cas(j, st, JOB_DONE)) sem_post(&j->done);
+                else st = JOB_ABANDONED;   // session timed out meanwhile
+            }
+            if (st == JOB_ABANDONED && job_cas(j, JOB_ABANDONED, JOB_FREE))
+                sem_post(&hpool->slots);
+        }
+        fprintf(stderr, "hash worker %d (pid %d) exited; restarting\n", w, (int)pid);
+        __atomic_add_fetch(&hpool->restarts, 1, __ATOMIC_RELAXED);
+        hash_spawn(w, listen_fd);
+        return;
+    }
+}
+
+// Create the shared queue and fork the hashing workers (call once from main)
+int start_hash_pool(void) {
+    hpool = mmap(NULL, sizeof(hash_pool), PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (hpool == MAP_FAILED) { hpool = NULL; perror("mmap"); return -1; }
+    memset(hpool, 0, sizeof(*hpool));
+    sem_init(&hpool->lock,  1, 1);
+    sem_init(&hpool->items, 1, 0);
+    sem_init(&hpool->slots, 1, HASH_QUEUE_MAX);
+    for (int i=0;i<HASH_QUEUE_MAX;i++) sem_init(&hpool->job[i].done, 1, 0);
+
+    for (int i=0;i<HASH_WORKERS;i++) {
+        hpool->cur[i] = -1;
+        if (hash_spawn(i, -1) < 0) return -1;
+    }
+    return 0;
+}
+
+// Queue one scrypt job and wait (bounded) for it. The session process sleeps
+// on a semaphore while a worker does the CPU/memory-heavy part.
+// Returns 0 on success, -1 if the queue is full or the request timed out.
+int hash_request(const char *pwd, const uint8_t *salt,
+                 int logn, int r, int p, uint8_t *dk) {
+    if (!hpool) return -1;
+    if (sem_trywait(&hpool->slots) < 0) {
+        __atomic_add_fetch(&hpool->rejected, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int idx = -1;
+    for (int i=0;i<HASH_QUEUE_MAX && idx<0;i++)
+        if (job_cas(&hpool->job[i], JOB_FREE, JOB_PENDING)) idx = i;
+    hash_job *j = &hpool->job[idx];
+    while (sem_trywait(&j->done) == 0) ;   // drop a stale post, if any
+    size_t pl = strlen(pwd);
+    if (pl >= PWD_MAX) {
+        // Same trick HMAC uses for long keys: the job slot stays fixed-size
+        sha256_ctx h;
+        sha256_init(&h); sha256_update(&h, pwd, pl); sha256_final(&h, j->pwd);
+        j->pwlen = 32;
+    } else {
+        memcpy(j->pwd, pwd, pl);
+        j->pwlen = pl;
+    }
+    memcpy(j->salt, salt, SALT_LEN);
+    j->logn = logn; j->r = r; j->p = p;
+    j->enq_us = now_us();
+
+    sem_wait(&hpool->lock);
+    hpool->ring[hpool->tail] = idx;
+    hpool->tail = (hpool->tail + 1) % HASH_QUEUE_MAX;
+    sem_post(&hpool->lock);
+    __atomic_add_fetch(&hpool->depth, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hpool->submitted, 1, __ATOMIC_RELAXED);
+    sem_post(&hpool->items);
+
+    struct timespec dl;
+    clock_gettime(CLOCK_REALTIME, &dl);
+    dl.tv_sec  += HASH_TIMEOUT_MS / 1000;
+    dl.tv_nsec += (HASH_TIMEOUT_MS % 1000) * 1000000L;
+    if (dl.tv_nsec >= 1000000000L) { dl.tv_sec++; dl.tv_nsec -= 1000000000L; }
+
+    int rc;
+    while ((rc = sem_timedwait(&j->done, &dl)) < 0 && errno == EINTR) ;
+    if (rc < 0) {
+        // Hand the slot over to the worker; it frees it when it gets there
+        if (job_cas(j, JOB_PENDING, JOB_ABANDONED) || job_cas(j, JOB_RUNNING, JOB_ABANDONED)) {
+            __atomic_add_fetch(&hpool->timeouts, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        // Finished just as we timed out: fall through and take the result
+    }
+    int failed = j->failed;
+    if (!failed) memcpy(dk, j->dk, DK_LEN);
+    job_release(idx);
+    return failed ? -1 : 0;
+}
+
+static void hex_encode(const uint8_t *in, size_t n, char *out) {
+    static const char hx[] = "0123456789abcdef";
+    for (size_t i=0;i<n;i++) { out[2*i] = hx[in[i]>>4]; out[2*i+1] = hx[in[i]&15]; }
+    out[2*n] = '\0';
+}
+
+static int hex_decode(const char *in, uint8_t *out, size_t n) {
+    for (size_t i=0;i<n;i++) {
+        int v = 0;
+        for (int k=0;k<2;k++) {
+            char c = in[2*i+k];
+            v <<= 4;
+            if (c>='0'&&c<='9') v |= c-'0';
+            else if (c>='a'&&c<='f') v |= c-'a'+10;
+            else return -1;
+        }
+        out[i] = v;
+    }
+    return in[2*n]=='\0' || in[2*n]=='$' ? 0 : -1;
+}
+
+// Stored hashes look like $s1$<logN>$<r>$<p>$<salt hex>$<dk hex> (no ':')
+int is_hashed(const char *stored) {
+    return !strncmp(stored, "$s1$", 4);
+}
+
+// Hash a new password into out. Returns 0, or -1 if the pool is busy.
+int hash_password(const char *pwd, char *out, size_t outsz) {
+    uint8_t salt[SALT_LEN], dk[DK_LEN];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd<0 || read(fd, salt, SALT_LEN) != SALT_LEN) { if (fd>=0) close(fd); return -1; }
+    close(fd);
+    if (hash_request(pwd, salt, SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, dk) < 0) return -1;
+
+    char sh[2*SALT_LEN+1], dh[2*DK_LEN+1];
+    hex_encode(salt, SALT_LEN, sh);
+    hex_encode(dk, DK_LEN, dh);
+    snprintf(out, outsz, "$s1$%d$%d$%d$%s$%s", SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, sh, dh);
+    return 0;
+}
+
+// Check pwd against a stored field (hashed or legacy plaintext).
+// Returns 1 on match, 0 on mismatch, -1 if the pool could not answer.
+int verify_password(const char *stored, const char *pwd) {
+    if (!is_hashed(stored)) return strcmp(stored, pwd) == 0;
+
+    int logn, r, p, off = 0;
+    uint8_t salt[SALT_LEN], want[DK_LEN], got[DK_LEN];
+    if (sscanf(stored, "$s1$%d$%d$%d$%n", &logn, &r, &p, &off) != 3 || !off) return 0;
+    if (hex_decode(stored+off, salt, SALT_LEN) < 0) return 0;
+    if (hex_decode(stored+off+2*SALT_LEN+1, want, DK_LEN) < 0) return 0;
+    if (hash_request(pwd, salt, logn, r, p, got) < 0) return -1;
+
+    uint8_t diff = 0;
+    for (int i=0;i<DK_LEN;i++) diff |= want[i]^got[i];
+    return diff == 0;
+}
+
+// Send the pool counters to an admin session
+void send_hash_stats(int cfd) {
+    long done = __atomic_load_n(&hpool->completed, __ATOMIC_RELAXED);
+    char out[BUF_SIZE];
+    snprintf(out, sizeof(out),
+             "Hash pool: workers=%d queue=%ld/%d submitted=%ld completed=%ld "
+             "rejected=%ld timeouts=%ld restarts=%ld\n"
+             "Latency: avg_wait=%ldus avg_hash=%ldus max_hash=%ldus\n",
+             HASH_WORKERS, __atomic_load_n(&hpool->depth, __ATOMIC_RELAXED), HASH_QUEUE_MAX,
+             __atomic_load_n(&hpool->submitted, __ATOMIC_RELAXED), done,
+             __atomic_load_n(&hpool->rejected, __ATOMIC_RELAXED),
+             __atomic_load_n(&hpool->timeouts, __ATOMIC_RELAXED),
+             __atomic_load_n(&hpool->restarts, __ATOMIC_RELAXED),
+             done ? __atomic_load_n(&hpool->wait_us_total, __ATOMIC_RELAXED)/done : 0,
+             done ? __atomic_load_n(&hpool->hash_us_total, __ATOMIC_RELAXED)/done : 0,
+             __atomic_load_n(&hpool->hash_us_max, __ATOMIC_RELAXED));
+    send_str(cfd, out);
+}
 
+// Replace only the password field of record id, re-reading it under the
+// data lock so changes made while we waited for the hash are kept. With
+// expect set, nothing is written unless the field still holds that value.
+// Returns 1 if the record was rewritten.
+int set_password_sys(const char *file, const char *id, const char *expect,
+                     const char *hash, int cfd) {
+    lock_data();
+    FILE *f = fopen(file,"r");
+    char line[BUF_SIZE], rec[BUF_SIZE] = "";
+    while (f && fgets(line,sizeof(line),f)) {
+        trim(line);
+        char *fld[4] = {0}, *p=line; int i=0;
+        while (i<4 && p) { fld[i++] = p; p=strchr(p,':'); if (p)*p++ = '\0'; }
+        if (!fld[2] || strcmp(fld[0],id)) continue;
+        if (expect && strcmp(fld[2],expect)) break;
+        if (fld[3]) snprintf(rec,sizeof(rec),"%s:%s:%s:%s",fld[0],fld[1],hash,fld[3]);
+        else        snprintf(rec,sizeof(rec),"%s:%s:%s",fld[0],fld[1],hash);
+        break;
+    }
+    if (f) fclose(f);
+    int rc = rec[0] ? rewrite_single_line_sys(file, id, rec, cfd) : 0;
+    unlock_data();
+    return rc;
+}
 
-int authenticate(const char *file, const char *name, const char *pwd, int check_active) {
+// Returns 1 on success, 0 on bad credentials, -1 if the hash pool is busy.
+// A legacy plaintext record that matches is upgraded to an scrypt hash.
+int authenticate(const char *file, const char *name, const char *pwd, int check_active, int cfd) {
     FILE *f = fopen(file,"r");
     if(!f) return 0;
-    char line[BUF_SIZE], *fld[4];
+    char line[BUF_SIZE], *fld[4], uid[BUF_SIZE], old[BUF_SIZE], h[BUF_SIZE] = "";
     int ok = 0;
     while (fgets(line,sizeof(line),f)) {
         trim(line);
         if (!*line) continue;
         char *p = line; int i=0;
+        fld[1] = fld[2] = fld[3] = NULL;
         while (i<4 && p) { fld[i++] = p; p=strchr(p,':'); if (p)*p++ = '\0'; }
-        if (fld[1] && fld[2] && strcmp(fld[1],name)==0 && strcmp(fld[2],pwd)==0) {
-            if (!check_active) ok = 1;
-            else if (fld[3] && strcmp(fld[3],"active")==0) ok = 1;
+        if (fld[1] && fld[2] && strcmp(fld[1],name)==0) {
+            if (check_active && !(fld[3] && strcmp(fld[3],"active")==0)) continue;
+            ok = verify_password(fld[2], pwd);
+            if (ok==1 && !is_hashed(fld[2])) {
+                strcpy(uid, fld[0]);
+                strcpy(old, fld[2]);
+                if (hash_password(pwd, h, sizeof(h)) < 0) h[0] = '\0';
+            }
         }
         if (ok) break;
     }
     fclose(f);
+    // Pool busy during the upgrade is fine: we retry on the next login.
+    // Skipped if the password changed while we were hashing.
+    if (h[0]) set_password_sys(file, uid, old, h, cfd);
     return ok;
 }
 
@@ -232,8 +803,9 @@ int find_id_by_name(const char *file,const char *name,char *id_out){
 
 void toggle_student_status(const char *sid,int cfd){
 
+    lock_data();  // the status we flip must still be current at rename time
     FILE *f = fopen(STUD_FILE,"r");
-    if(!f){ send_str(cfd,"Error\n"); return; }
+    if(!f){ unlock_data(); send_str(cfd,"Error\n"); return; }
     char line[BUF_SIZE], prefix[BUF_SIZE];
     snprintf(prefix,sizeof(prefix),"%s:",sid);
     int found=0;
@@ -241,7 +813,7 @@ void toggle_student_status(const char *sid,int cfd){
         if (!strncmp(line,prefix,strlen(prefix))) { found=1; break; }
     }
     fclose(f);
-    if(!found){ send_str(cfd,"Not found\n"); return; }
+    if(!found){ unlock_data(); send_str(cfd,"Not found\n"); return; }
     trim(line);
     char *fld[4], *p=line; int i=0;
     while(i<4 && p){ fld[i++] = p; p=strchr(p,':'); if(p)*p++ = '\0'; }
@@ -249,13 +821,862 @@ void toggle_student_status(const char *sid,int cfd){
     char rec[BUF_SIZE];
     snprintf(rec,sizeof(rec),"%s:%s:%s:%s",fld[0],fld[1],fld[2],newst);
     rewrite_single_line_sys(STUD_FILE, fld[0], rec, cfd);
+    unlock_data();
     send_str(cfd,"Toggled.\n");
 }
 
+// ---------------------------------------------------------------------------
+// Seat watches. A student session subscribes to a course; any session that
+// changes the course marks every subscriber dirty and signals it once.
+// Further changes before the subscriber flushes only find the flag already
+// set, so a burst of updates becomes a single message per subscriber.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    pid_t    pid;                 // owning session, 0 = free slot
+    unsigned gen;                 // owner's session generation
+    int   dirty;                  // set by notifiers, cleared by the owner
+    char  cid[CID_MAX];
+} watch_slot;
+
+typedef struct {
+    sem_t      lock;              // guards slot allocation only
+    unsigned   next_gen;          // hands out session generations
+    watch_slot w[MAX_WATCHES];
+} watch_table;
+
+static watch_table *watches;
+static unsigned my_gen;           // this session's generation
+static pid_t    my_pid;           // cached: getpid() is a syscall
+static int      my_watches;       // slots this session holds
+sigset_t watch_waitmask;          // session mask with SIGUSR1 unblocked
+
+int start_watch_table(void) {
+    watches = mmap(NULL, sizeof(watch_table), PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (watches == MAP_FAILED) { watches = NULL; perror("mmap"); return -1; }
+    memset(watches, 0, sizeof(*watches));
+    sem_init(&watches->lock, 1, 1);
+    return 0;
+}
+
+static void on_watch_signal(int sig) { (void)sig; }  // only to interrupt ppoll()
+
+// Keep SIGUSR1 blocked everywhere except the ppoll in read_line, so file
+// and lock syscalls are never interrupted and no wakeup is lost.
+void watch_init_session(void) {
+    struct sigaction sa;
+    sigset_t block;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_watch_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigemptyset(&block);
+    sigaddset(&block, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &block, &watch_waitmask);
+    sigdelset(&watch_waitmask, SIGUSR1);
+    my_gen = __atomic_add_fetch(&watches->next_gen, 1, __ATOMIC_RELAXED);
+    my_pid = getpid();
+}
+
+// A slot is ours only if both pid and generation match, so a slot left
+// behind under a reused pid is never mistaken for this session's.
+static int watch_mine(const watch_slot *w) {
+    return __atomic_load_n(&w->pid, __ATOMIC_ACQUIRE) == my_pid && w->gen == my_gen;
+}
+
+// Subscribe this session to cid, or unsubscribe if already watching.
+// Returns 1 if now watching, 0 if removed, -1 if the table is full.
+int watch_toggle(const char *cid) {
+    int rc = -1;
+    while (sem_wait(&watches->lock) < 0 && errno == EINTR) ;
+    for (int i=0;i<MAX_WATCHES;i++) {
+        watch_slot *w = &watches->w[i];
+        if (watch_mine(w) && !strcmp(w->cid, cid)) {
+            __atomic_store_n(&w->pid, 0, __ATOMIC_RELEASE);
+            my_watches--;
+            rc = 0;
+            break;
+        }
+    }
+    for (int i=0;i<MAX_WATCHES && rc<0;i++) {
+        watch_slot *w = &watches->w[i];
+        if (w->pid && kill(w->pid, 0) < 0 && errno == ESRCH) w->pid = 0;  // reclaim stale
+        if (!w->pid) {
+            snprintf(w->cid, sizeof(w->cid), "%s", cid);
+            w->gen = my_gen;
+            w->dirty = 0;
+            __atomic_store_n(&w->pid, my_pid, __ATOMIC_RELEASE);
+            my_watches++;
+            rc = 1;
+        }
+    }
+    sem_post(&watches->lock);
+    return rc;
+}
+
+// Drop every watch owned by this session (logout/exit)
+void watch_release_all(void) {
+    for (int i=0;i<MAX_WATCHES && my_watches;i++)
+        if (watch_mine(&watches->w[i])) {
+            __atomic_store_n(&watches->w[i].pid, 0, __ATOMIC_RELEASE);
+            my_watches--;
+        }
+}
+
+// Drop every watch of a dead session; called by the parent before it reaps
+// the child, so the pid cannot have been reused yet.
+void watch_release_pid(pid_t pid) {
+    for (int i=0;i<MAX_WATCHES;i++) {
+        pid_t p = pid;
+        __atomic_compare_exchange_n(&watches->w[i].pid, &p, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+// Client disconnected or session finished
+void end_session(int cfd) {
+    watch_release_all();
+    close(cfd);
+    exit(0);
+}
+
+// Tell every subscriber of cid that its seat count changed
+void notify_course(const char *cid) {
+    for (int i=0;i<MAX_WATCHES;i++) {
+        watch_slot *w = &watches->w[i];
+        pid_t pid = __atomic_load_n(&w->pid, __ATOMIC_ACQUIRE);
+        if (!pid || strcmp(w->cid, cid)) continue;
+        if (__atomic_exchange_n(&w->dirty, 1, __ATOMIC_ACQ_REL)) continue;  // already pending
+        if (kill(pid, SIGUSR1) < 0 && errno == ESRCH)
+            __atomic_compare_exchange_n(&w->pid, &pid, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+// Max seats for cid, or -1 if the course does not exist
+int course_max_seats(const char *cid) {
+    FILE *cf = fopen(CRS_FILE, "r");
+    char cline[BUF_SIZE];
+    int max = -1;
+    while (cf && fgets(cline, sizeof(cline), cf)) {
+        trim(cline);
+        char *fld[4] = {0}, *p = cline; int i = 0;
+        while (i<4 && p) { fld[i++] = p; p = strchr(p, ':'); if (p) *p++ = '\0'; }
+        if (fld[3] && !strcmp(fld[0], cid)) { max = atoi(fld[3]); break; }
+    }
+    if (cf) fclose(cf);
+    return max;
+}
+
+// Push one line per dirty watch of this session to the client
+void flush_notifications(int cfd) {
+    if (!watches || !my_watches) return;
+    for (int i=0;i<MAX_WATCHES;i++) {
+        watch_slot *w = &watches->w[i];
+        if (!watch_mine(w) || !__atomic_exchange_n(&w->dirty, 0, __ATOMIC_ACQ_REL)) continue;
+        char out[BUF_SIZE];
+        int max = course_max_seats(w->cid);
+        if (max < 0) {
+            snprintf(out, sizeof(out), "\n[Watch] Course %s was removed.\n", w->cid);
+            __atomic_store_n(&w->pid, 0, __ATOMIC_RELEASE);
+            my_watches--;
+        } else {
+            int taken = count_enroll_sys(w->cid);
+            snprintf(out, sizeof(out), "\n[Watch] Course %s: %d/%d seats taken%s\n",
+                     w->cid, taken, max, taken < max ? ", seat available" : "");
+        }
+        send_str(cfd, out);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Timetable. A course may carry meeting slots as a 5th field of courses.txt
+// (e.g. MON0900-1030;WED0900-1030). Each student's booked slots are kept in
+// a shared index as a sorted, non-overlapping array, so the enroll-time
+// clash check is a binary search per slot instead of a scan of all courses.
+// Students the index cannot hold fall back to that scan (tt_scan).
+// ---------------------------------------------------------------------------
+
+typedef struct { int start, end; char cid[CID_MAX]; } tt_iv;   // minutes from MON 00:00
+typedef struct { char sid[CID_MAX]; int n, partial; tt_iv iv[TT_SLOTS]; } tt_student;  // partial: check by tt_scan
+typedef struct { sem_t lock; int n; tt_student s[TT_STUDENTS]; } tt_index;  // s[] sorted by sid
+
+static tt_index *tt;
+static const char *DAYS[7] = { "MON","TUE","WED","THU","FRI","SAT","SUN" };
+
+// Parse "MON0900-1030;WED0900-1030" into iv[]. Returns the slot count,
+// or -1 if a slot is malformed or two slots of the course overlap.
+int parse_slots(const char *s, tt_iv *iv, int max) {
+    char copy[BUF_SIZE], *save;
+    int n = 0;
+    snprintf(copy, sizeof(copy), "%s", s);
+    for (char *p = strtok_r(copy, ";", &save); p; p = strtok_r(NULL, ";", &save)) {
+        char day[4];
+        int d, h1, m1, h2, m2;
+        if (n >= max || strlen(p) != 12 || p[7] != '-') return -1;
+        for (int k=3;k<12;k++)            // %2d alone would take "-1" or " 9"
+            if (k != 7 && (p[k] < '0' || p[k] > '9')) return -1;
+        if (sscanf(p, "%3s%2d%2d-%2d%2d", day, &h1, &m1, &h2, &m2) != 5) return -1;
+        for (d = 0; d < 7 && strcmp(day, DAYS[d]); d++) ;
+        if (d == 7 || h1 < 0 || m1 < 0 || h2 < 0 || m2 < 0 ||
+            h1 > 23 || m1 > 59 || h2 > 24 || m2 > 59) return -1;
+        iv[n].start = d*1440 + h1*60 + m1;
+        iv[n].end   = d*1440 + h2*60 + m2;
+        iv[n].cid[0] = '\0';
+        if (iv[n].end <= iv[n].start || iv[n].end > (d+1)*1440) return -1;
+        for (int k=0;k<n;k++)
+            if (iv[k].start < iv[n].end && iv[n].start < iv[k].end) return -1;
+        n++;
+    }
+    return n;
+}
+
+// "MON 09:00-10:30"
+void format_slot(const tt_iv *iv, char *out, size_t sz) {
+    int d = iv->start / 1440, a = iv->start % 1440, b = iv->end - d*1440;
+    snprintf(out, sz, "%s %02d:%02d-%02d:%02d", DAYS[d], a/60, a%60, b/60, b%60);
+}
+
+// Slots of cid from courses.txt. Returns the count (0 = unscheduled),
+// or -1 if the course does not exist.
+int course_slots(const char *cid, tt_iv *iv, int max) {
+    FILE *cf = fopen(CRS_FILE, "r");
+    char cline[BUF_SIZE];
+    int n = -1;
+    while (cf && fgets(cline, sizeof(cline), cf)) {
+        trim(cline);
+        char *fld[5] = {0}, *p = cline; int i = 0;
+        while (i<5 && p) { fld[i++] = p; p = strchr(p, ':'); if (p) *p++ = '\0'; }
+        if (strcmp(fld[0], cid)) continue;
+        n = fld[4] && *fld[4] ? parse_slots(fld[4], iv, max) : 0;
+        if (n < 0) n = 0;   // unparsable schedule: treat as unscheduled
+        break;
+    }
+    if (cf) fclose(cf);
+    return n;
+}
+
+// Binary search for sid; optionally insert an empty entry in order
+static tt_student *tt_find(const char *sid, int create) {
+    int lo = 0, hi = tt->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2, c = strcmp(tt->s[mid].sid, sid);
+        if (!c) return &tt->s[mid];
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
+    if (!create || tt->n >= TT_STUDENTS) return NULL;
+    memmove(&tt->s[lo+1], &tt->s[lo], (tt->n - lo) * sizeof(tt_student));
+    memset(&tt->s[lo], 0, sizeof(tt_student));
+    snprintf(tt->s[lo].sid, sizeof(tt->s[lo].sid), "%s", sid);
+    tt->n++;
+    return &tt->s[lo];
+}
+
+// Index of the first booking that ends after t. Bookings are disjoint, so
+// ordering by start and by end is the same.
+static int tt_lower(const tt_student *st, int t) {
+    int lo = 0, hi = st->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (st->iv[mid].end <= t) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Book cid's slots for sid unless one overlaps another course.
+// Returns 0 if booked (or already booked), 1 on a clash (clash set),
+// -1 if sid is not fully indexed; the caller must then use tt_scan.
+int tt_book(const char *sid, const char *cid, const tt_iv *iv, int n, tt_iv *clash) {
+    if (!tt || n <= 0) return 0;   // unscheduled courses never clash
+    int rc = 0;
+    while (sem_wait(&tt->lock) < 0 && errno == EINTR) ;
+    tt_student *st = tt_find(sid, 1);
+    if (!st || st->partial) rc = -1;
+    for (int i=0;i<n && !rc;i++) {
+        int j = tt_lower(st, iv[i].start);
+        if (j < st->n && st->iv[j].start < iv[i].end) {
+            if (!strcmp(st->iv[j].cid, cid)) { rc = 2; break; }  // already booked
+            if (clash) *clash = st->iv[j];
+            rc = 1;
+        }
+    }
+    if (!rc && st->n + n > TT_SLOTS) { st->partial = 1; rc = -1; }
+    for (int i=0;i<n && !rc;i++) {
+        int j = tt_lower(st, iv[i].start);
+        memmove(&st->iv[j+1], &st->iv[j], (st->n - j) * sizeof(tt_iv));
+        st->iv[j] = iv[i];
+        snprintf(st->iv[j].cid, sizeof(st->iv[j].cid), "%s", cid);
+        st->n++;
+    }
+    sem_post(&tt->lock);
+    return rc == 2 ? 0 : rc;
+}
+
+static void tt_unbook_locked(tt_student *st, const char *cid) {
+    int k = 0;
+    for (int i=0;i<st->n;i++)
+        if (strcmp(st->iv[i].cid, cid)) st->iv[k++] = st->iv[i];
+    st->n = k;
+}
+
+// Release sid's bookings for cid (unenroll)
+void tt_unbook(const char *sid, const char *cid) {
+    if (!tt) return;
+    while (sem_wait(&tt->lock) < 0 && errno == EINTR) ;
+    tt_student *st = tt_find(sid, 0);
+    if (st) tt_unbook_locked(st, cid);
+    sem_post(&tt->lock);
+}
+
+// Release every booking of cid (course removed)
+void tt_drop_course(const char *cid) {
+    if (!tt) return;
+    while (sem_wait(&tt->lock) < 0 && errno == EINTR) ;
+    for (int i=0;i<tt->n;i++) tt_unbook_locked(&tt->s[i], cid);
+    sem_post(&tt->lock);
+}
+
+// Clash check straight from an enrollments file: cid's slots against every
+// other course sid is in. Slower, but has no capacity limit.
+// Returns 1 on a clash (clash set), else 0.
+int tt_scan(const char *enr, const char *sid, const char *cid,
+            const tt_iv *iv, int n, tt_iv *clash) {
+    FILE *ef = fopen(enr, "r");
+    char line[BUF_SIZE];
+    int rc = 0;
+    while (!rc && ef && fgets(line, sizeof(line), ef)) {
+        trim(line);
+        char *list = strchr(line, ':'), *save;
+        if (!list) continue;
+        *list++ = '\0';
+        if (!strcmp(line, cid)) continue;
+        for (char *p = strtok_r(list, ",", &save); p; p = strtok_r(NULL, ",", &save)) {
+            if (strcmp(p, sid)) continue;
+            tt_iv other[SLOTS_MAX];
+            int m = course_slots(line, other, SLOTS_MAX);
+            for (int i=0;i<n && !rc;i++)
+                for (int j=0;j<m && !rc;j++)
+                    if (iv[i].start < other[j].end && other[j].start < iv[i].end) {
+                        if (clash) {
+                            *clash = other[j];
+                            snprintf(clash->cid, sizeof(clash->cid), "%s", line);
+                        }
+                        rc = 1;
+                    }
+            break;
+        }
+    }
+    if (ef) fclose(ef);
+    return rc;
+}
+
+// Enrollment line -> bookings (startup). An existing clash cannot go into
+// the index, so that student is marked partial and checked by tt_scan from
+// then on; the clash itself shows up in the faculty clash report.
+static void tt_build_line(const char *line, size_t len, void *ud) {
+    (void)ud;
+    char rec[BUF_SIZE];
+    tt_iv iv[SLOTS_MAX], clash;
+    memcpy(rec, line, len); rec[len] = '\0'; trim(rec);
+    char *colon = strchr(rec, ':');
+    if (!colon) return;
+    *colon = '\0';
+    int n = course_slots(rec, iv, SLOTS_MAX);
+    if (n <= 0) return;
+    for (char *p = strtok(colon + 1, ","); p; p = strtok(NULL, ",")) {
+        int b = tt_book(p, rec, iv, n, &clash);
+        if (b > 0) {
+            fprintf(stderr, "timetable: student %s: %s clashes with %s\n", p, rec, clash.cid);
+            tt_student *st = tt_find(p, 0);   // startup: single process, no lock needed
+            if (st) st->partial = 1;
+        }
+        if (b < 0)
+            fprintf(stderr, "timetable: index full at student %s course %s; "
+                            "raise TT_STUDENTS/TT_SLOTS (checks for them now scan %s)\n",
+                    p, rec, ENR_FILE);
+    }
+}
+
+// Create the shared index and load it from the data files (call from main)
+int start_timetable(void) {
+    tt = mmap(NULL, sizeof(tt_index), PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (tt == MAP_FAILED) { tt = NULL; perror("mmap"); return -1; }
+    memset(tt, 0, sizeof(*tt));
+    sem_init(&tt->lock, 1, 1);
+    read_file_lines_sys(ENR_FILE, tt_build_line, NULL);
+    return 0;
+}
+
+// Bulk report for faculty fid: every student in one of their courses who is
+// also enrolled in a course with an overlapping slot. Reads the data files
+// directly, so clashes that predate the enroll-time check are listed too.
+// Enrollments become one (sid, course) array sorted by sid, so each student's
+// courses are adjacent and only pairs within a student are compared.
+
+typedef struct { char cid[CID_MAX], name[64], fid[CID_MAX]; int n; tt_iv iv[SLOTS_MAX]; } rpt_course;
+typedef struct { char sid[CID_MAX]; const rpt_course *c; } rpt_pair;
+
+static int rpt_course_cmp(const void *a, const void *b) {
+    return strcmp(((const rpt_course*)a)->cid, ((const rpt_course*)b)->cid);
+}
+
+static int rpt_pair_cmp(const void *a, const void *b) {
+    const rpt_pair *x = a, *y = b;
+    int c = strcmp(x->sid, y->sid);
+    return c ? c : strcmp(x->c->cid, y->c->cid);
+}
+
+// Grow *arr (of *cap elements of sz bytes) so index n fits
+static int rpt_grow(void **arr, size_t *cap, size_t n, size_t sz) {
+    if (n < *cap) return 0;
+    size_t nc = *cap ? *cap * 2 : 64;
+    void *p = realloc(*arr, nc * sz);
+    if (!p) return -1;
+    *arr = p; *cap = nc;
+    return 0;
+}
+
+void send_clash_report(int cfd, const char *fid) {
+    rpt_course *c = NULL, key;
+    rpt_pair *pr = NULL;
+    size_t nc = 0, cc = 0, np = 0, pc = 0;
+    int found = 0, oom = 0;
+    char line[BUF_SIZE], out[BUF_SIZE];
+
+    // Scheduled courses, sorted by cid for lookup
+    FILE *f = fopen(CRS_FILE, "r");
+    while (f && !oom && fgets(line, sizeof(line), f)) {
+        trim(line);
+        char *fld[5] = {0}, *p = line; int i = 0;
+        while (i<5 && p) { fld[i++] = p; p = strchr(p, ':'); if (p) *p++ = '\0'; }
+        if (!fld[2] || !fld[4] || !*fld[4]) continue;
+        if (rpt_grow((void**)&c, &cc, nc, sizeof(*c)) < 0) { oom = 1; break; }
+        if ((c[nc].n = parse_slots(fld[4], c[nc].iv, SLOTS_MAX)) <= 0) continue;
+        snprintf(c[nc].cid,  sizeof(c[nc].cid),  "%s", fld[0]);
+        snprintf(c[nc].name, sizeof(c[nc].name), "%s", fld[1]);
+        snprintf(c[nc].fid,  sizeof(c[nc].fid),  "%s", fld[2]);
+        nc++;
+    }
+    if (f) fclose(f);
+    if (nc) qsort(c, nc, sizeof(*c), rpt_course_cmp);
+
+    // Enrollments, streamed a byte at a time so no list is cut off.
+    // EOF counts as a final newline.
+    f = fopen(ENR_FILE, "r");
+    char tok[CID_MAX];
+    size_t tl = 0;
+    const rpt_course *cur = NULL;
+    int in_list = 0, ch;
+    do {
+        ch = f ? getc(f) : EOF;
+        int x = ch == EOF ? '\n' : ch;
+        if (x == '\r' || x == ' ') continue;
+        if (!in_list && x == ':') {
+            tok[tl] = '\0';
+            snprintf(key.cid, sizeof(key.cid), "%s", tok);
+            cur = nc ? bsearch(&key, c, nc, sizeof(*c), rpt_course_cmp) : NULL;
+            in_list = 1; tl = 0;
+        } else if (x == ',' || x == '\n') {
+            if (in_list && tl && cur) {
+                if (rpt_grow((void**)&pr, &pc, np, sizeof(*pr)) < 0) { oom = 1; break; }
+                tok[tl] = '\0';
+                snprintf(pr[np].sid, sizeof(pr[np].sid), "%s", tok);
+                pr[np++].c = cur;
+            }
+            tl = 0;
+            if (x == '\n') { in_list = 0; cur = NULL; }
+        } else if (tl + 1 < sizeof(tok)) tok[tl++] = x;
+    } while (ch != EOF);
+    if (f) fclose(f);
+    if (oom) { free(c); free(pr); send_str(cfd, "Error\n"); return; }
+    if (np) qsort(pr, np, sizeof(*pr), rpt_pair_cmp);
+    size_t k = 0;                                       // drop repeated entries
+    for (size_t i=0;i<np;i++)
+        if (!k || rpt_pair_cmp(&pr[k-1], &pr[i])) pr[k++] = pr[i];
+    np = k;
+
+    send_str(cfd, "Timetable clashes in your courses:\n");
+    for (size_t i=0, j;i<np;i=j) {
+        for (j=i+1;j<np && !strcmp(pr[j].sid, pr[i].sid);j++) ;
+        for (size_t x=i;x<j;x++) for (size_t y=x+1;y<j;y++) {
+            const rpt_course *a = pr[x].c, *b = pr[y].c;
+            if (strcmp(a->fid, fid)) {          // lead with fid's own course
+                if (strcmp(b->fid, fid)) continue;
+                const rpt_course *t = a; a = b; b = t;
+            }
+            for (int u=0;u<a->n;u++) for (int v=0;v<b->n;v++) {
+                if (a->iv[u].start >= b->iv[v].end || b->iv[v].start >= a->iv[u].end) continue;
+                char sa[32], sb[32];
+                format_slot(&a->iv[u], sa, sizeof(sa));
+                format_slot(&b->iv[v], sb, sizeof(sb));
+                snprintf(out, sizeof(out), "Student %s: %s(%s) %s clashes with %s(%s) %s\n",
+                         pr[i].sid, a->name, a->cid, sa, b->name, b->cid, sb);
+                send_str(cfd, out);
+                found++;
+            }
+        }
+    }
+    snprintf(out, sizeof(out), found ? "%d clash(es).\n" : "No clashes.\n", found);
+    send_str(cfd, out);
+    free(c); free(pr);
+}
+
+// ---------------------------------------------------------------------------
+// Batch transactions. An admin submits many mutations at once; they are
+// validated and applied in a single streaming pass per affected file into
+// temp files, which replace the originals only if every op succeeded.
+// ---------------------------------------------------------------------------
+
+enum { OP_TOGGLE, OP_UPD_STU, OP_UPD_FAC, OP_ENROLL, OP_UNENROLL };
+
+typedef struct {
+    int  kind;
+    int  line;                    // batch line number, for error reports
+    char id[CID_MAX];             // student/faculty id (student id for enroll ops)
+    char cid[CID_MAX];            // course id (enroll ops)
+    char name[64];
+    char pwd[160];                // scrypt hash (update ops)
+    int  max;                     // course max seats, -1 = no such course
+    int  nslots;                  // course meeting slots (enroll ops)
+    tt_iv slot[SLOTS_MAX];
+    int  seen;                    // target record was found
+    int  applied;                 // enroll op already folded into a line
+    int  booked;                  // timetable index updated (undo on abort)
+    char clash[CID_MAX];          // course clashed with, for the report
+    const char *err;
+} batch_op;
+
+typedef struct {
+    batch_op *op;
+    int       n;
+    int       fd_out;             // temp file for rewriting passes, -1 for read-only
+    int       changed;
+} batch_pass;
+
+// Parse one batch line into ops; toggle and enroll/unenroll lines may list
+// several students separated by ';'. Returns ops added, or -1 with *err set.
+static int batch_parse(char *line, int lineno, batch_op *op, int room, const char **err) {
+    char *t = strtok(line, ","), *a = strtok(NULL, ","), *b = strtok(NULL, ",");
+    char *c = strtok(NULL, ","), *d = strtok(NULL, ",");
+    int n = 0;
+    *err = "syntax error";
+    if (!t || !a) return -1;
+    if (!strcmp(t, "toggle")) {
+        for (char *s = strtok(a, ";"); s; s = strtok(NULL, ";")) {
+            if (n >= room) { *err = "batch too large"; return -1; }
+            memset(&op[n], 0, sizeof(op[n]));
+            op[n].kind = OP_TOGGLE; op[n].line = lineno;
+            snprintf(op[n].id, sizeof(op[n].id), "%s", s);
+            n++;
+        }
+        return n ? n : -1;
+    }
+    if (!strcmp(t, "upd")) {
+        if (!b || !c || !d || (strcmp(a, "student") && strcmp(a, "faculty"))) return -1;
+        if (room < 1) { *err = "batch too large"; return -1; }
+        memset(op, 0, sizeof(*op));
+        op->kind = strcmp(a, "student") ? OP_UPD_FAC : OP_UPD_STU; op->line = lineno;
+        snprintf(op->id,   sizeof(op->id),   "%s", b);
+        snprintf(op->name, sizeof(op->name), "%s", c);
+        if (hash_password(d, op->pwd, sizeof(op->pwd)) < 0) { *err = "server busy"; return -1; }
+        return 1;
+    }
+    if (!strcmp(t, "enroll") || !strcmp(t, "unenroll")) {
+        if (!b) return -1;
+        for (char *s = strtok(b, ";"); s; s = strtok(NULL, ";")) {
+            if (n >= room) { *err = "batch too large"; return -1; }
+            memset(&op[n], 0, sizeof(op[n]));
+            op[n].kind = t[0]=='e' ? OP_ENROLL : OP_UNENROLL; op[n].line = lineno;
+            snprintf(op[n].cid, sizeof(op[n].cid), "%s", a);
+            snprintf(op[n].id,  sizeof(op[n].id),  "%s", s);
+            op[n].max = -1;
+            n++;
+        }
+        return n ? n : -1;
+    }
+    return -1;
+}
+
+static int is_enroll_op(const batch_op *o) { return o->kind==OP_ENROLL || o->kind==OP_UNENROLL; }
+
+// courses.txt (read-only): record max seats and slots for every course an op names
+static void batch_courses_line(const char *line, size_t len, void *ud) {
+    batch_pass *bp = ud;
+    char rec[BUF_SIZE], *fld[5] = {0}, *p = rec; int i = 0;
+    memcpy(rec, line, len); rec[len] = '\0'; trim(rec);
+    while (i<5 && p) { fld[i++] = p; p = strchr(p, ':'); if (p) *p++ = '\0'; }
+    if (!fld[3]) return;
+    for (int k=0;k<bp->n;k++) {
+        batch_op *o = &bp->op[k];
+        if (!is_enroll_op(o) || strcmp(o->cid, fld[0])) continue;
+        o->max = atoi(fld[3]);
+        o->nslots = fld[4] && *fld[4] ? parse_slots(fld[4], o->slot, SLOTS_MAX) : 0;
+        if (o->nslots < 0) o->nslots = 0;
+    }
+}
+
+// students.txt / faculty.txt: fold every toggle/update for a record into it
+static void batch_user_line(const char *line, size_t len, void *ud, int student) {
+    batch_pass *bp = ud;
+    char rec[BUF_SIZE], *fld[4] = {0}, *p = rec; int i = 0, hit = 0;
+    memcpy(rec, line, len); rec[len] = '\0'; trim(rec);
+    while (i<4 && p) { fld[i++] = p; p = strchr(p, ':'); if (p) *p++ = '\0'; }
+    if (!fld[0] || !*fld[0] || !fld[2]) { write(bp->fd_out, line, len); return; }
+
+    char name[BUF_SIZE], pwd[BUF_SIZE], st[16];
+    snprintf(name, sizeof(name), "%s", fld[1]);
+    snprintf(pwd,  sizeof(pwd),  "%s", fld[2]);
+    snprintf(st,   sizeof(st),   "%s", fld[3] ? fld[3] : "active");
+    for (int k=0;k<bp->n;k++) {
+        batch_op *o = &bp->op[k];
+        if (strcmp(o->id, fld[0])) continue;
+        if (student && is_enroll_op(o)) { o->seen = 1; continue; }
+        if (student && o->kind == OP_TOGGLE) {
+            snprintf(st, sizeof(st), "%s", strcmp(st, "active") ? "active" : "inactive");
+        } else if (o->kind == (student ? OP_UPD_STU : OP_UPD_FAC)) {
+            snprintf(name, sizeof(name), "%s", o->name);
+            snprintf(pwd,  sizeof(pwd),  "%s", o->pwd);
+        } else continue;
+        o->seen = 1; hit = 1;
+    }
+    if (!hit) { write(bp->fd_out, line, len); return; }
+
+    char out[BUF_SIZE];
+    int n = student ? snprintf(out, sizeof(out), "%s:%s:%s:%s\n", fld[0], name, pwd, st)
+                    : snprintf(out, sizeof(out), "%s:%s:%s\n", fld[0], name, pwd);
+    write(bp->fd_out, out, n);
+    bp->changed = 1;
+}
+
+static void batch_students_line(const char *line, size_t len, void *ud) { batch_user_line(line, len, ud, 1); }
+static void batch_faculty_line(const char *line, size_t len, void *ud)  { batch_user_line(line, len, ud, 0); }
+
+static int list_has(const char *list, const char *sid) {
+    char copy[BUF_SIZE];
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *p = strtok(copy, ","); p; p = strtok(NULL, ","))
+        if (!strcmp(p, sid)) return 1;
+    return 0;
+}
+
+// Apply, in order, every pending enroll/unenroll for cid to its student list
+static void batch_apply_course(batch_pass *bp, const char *cid, char *list, size_t lsz) {
+    for (int k=0;k<bp->n;k++) {
+        batch_op *o = &bp->op[k];
+        if (!is_enroll_op(o) || o->applied || o->err || strcmp(o->cid, cid)) continue;
+        o->applied = 1;
+        int cnt = 0;
+        if (list[0]) { cnt = 1; for (char *c = list; *c; c++) if (*c == ',') cnt++; }
+        if (o->kind == OP_ENROLL) {
+            if (list_has(list, o->id)) { o->err = "already enrolled"; continue; }
+            if (cnt >= o->max)         { o->err = "course is full";  continue; }
+            size_t l = strlen(list);
+            snprintf(list + l, lsz - l, "%s%s", l ? "," : "", o->id);
+        } else {
+            if (!list_has(list, o->id)) { o->err = "not enrolled"; continue; }
+            char kept[BUF_SIZE] = "", copy[BUF_SIZE];
+            snprintf(copy, sizeof(copy), "%s", list);
+            for (char *p = strtok(copy, ","); p; p = strtok(NULL, ","))
+                if (strcmp(p, o->id)) { if (kept[0]) strcat(kept, ","); strcat(kept, p); }
+            snprintf(list, lsz, "%s", kept);
+        }
+    }
+}
+
+static void batch_write_course(batch_pass *bp, const char *cid, const char *list) {
+    if (!list[0]) return;
+    char out[BUF_SIZE];
+    int n = snprintf(out, sizeof(out), "%s:%s\n", cid, list);
+    write(bp->fd_out, out, n);
+}
+
+// enrollments.txt: rewrite the list of every course the batch touches
+static void batch_enr_line(const char *line, size_t len, void *ud) {
+    batch_pass *bp = ud;
+    char rec[BUF_SIZE];
+    memcpy(rec, line, len); rec[len] = '\0'; trim(rec);
+    char *colon = strchr(rec, ':');
+    int touched = 0;
+    if (colon) {
+        *colon = '\0';
+        for (int k=0;k<bp->n && !touched;k++)
+            touched = is_enroll_op(&bp->op[k]) && !bp->op[k].applied && !strcmp(bp->op[k].cid, rec);
+    }
+    if (!touched) { write(bp->fd_out, line, len); return; }
+
+    char list[BUF_SIZE];
+    snprintf(list, sizeof(list), "%s", colon + 1);
+    batch_apply_course(bp, rec, list, sizeof(list));
+    batch_write_course(bp, rec, list);
+    bp->changed = 1;
+}
+
+// Run one pass of file through fn into a temp file next to the data.
+// Returns the temp fd (caller closes) or -1.
+static int batch_pass_file(const char *file, batch_pass *bp, char *tmp,
+                           void (*fn)(const char*, size_t, void*)) {
+    strcpy(tmp, "./tmp_batchXXXXXX");
+    bp->fd_out = mkstemp(tmp);
+    bp->changed = 0;
+    if (bp->fd_out < 0) return -1;
+    if (read_file_lines_sys(file, fn, bp) < 0) { close(bp->fd_out); unlink(tmp); return -1; }
+    return bp->fd_out;
+}
+
+// Read ops from the client until END and commit them all, or none.
+void run_batch(int cfd) {
+    batch_op *op = calloc(BATCH_MAX, sizeof(batch_op));
+    if (!op) { send_str(cfd, "Error\n"); return; }
+    batch_pass bp = { .op = op, .n = 0, .fd_out = -1 };
+    char buf[BUF_SIZE], out[BUF_SIZE];
+    const char *err = NULL;
+    int lineno = 0, bad = 0;
+
+    send_str(cfd,
+      "One op per line, END to commit, ABORT to cancel:\n"
+      "  toggle,sid[;sid...] | upd,student|faculty,id,name,pwd\n"
+      "  enroll,cid,sid[;sid...] | unenroll,cid,sid[;sid...]\n");
+    while (1) {
+        if (read_line(cfd, buf, sizeof(buf)) <= 0) { free(op); return; }
+        trim(buf);
+        if (!*buf) continue;
+        if (!strcmp(buf, "END")) break;
+        if (!strcmp(buf, "ABORT")) { free(op); send_str(cfd, "Batch aborted.\n"); return; }
+        lineno++;
+        int k = batch_parse(buf, lineno, op + bp.n, BATCH_MAX - bp.n, &err);
+        if (k < 0) {
+            snprintf(out, sizeof(out), "line %d: %s\n", lineno, err);
+            send_str(cfd, out);
+            bad = 1;
+        } else bp.n += k;
+    }
+    if (bad || !bp.n) {
+        send_str(cfd, bad ? "Batch rejected, nothing applied.\n" : "Empty batch.\n");
+        free(op);
+        return;
+    }
+
+    int need_stu = 0, need_fac = 0, need_enr = 0;
+    for (int k=0;k<bp.n;k++) {
+        if (op[k].kind == OP_UPD_FAC) need_fac = 1;
+        else need_stu = 1;
+        if (is_enroll_op(&op[k])) need_enr = 1;
+    }
+
+    const char *files[3] = { STUD_FILE, FAC_FILE, ENR_FILE };
+    int use[3] = { need_stu, need_fac, need_enr };
+    char tmp[3][32] = { "", "", "" };
+    int changed[3] = { 0, 0, 0 }, failed = 0;
+
+    // No other writer may run between validation and the last rename
+    lock_data();
+    if (need_enr) read_file_lines_sys(CRS_FILE, batch_courses_line, &bp);
+    for (int k=0;k<bp.n;k++)
+        if (is_enroll_op(&op[k]) && op[k].max < 0) op[k].err = "no such course";
+
+    void (*fns[2])(const char*, size_t, void*) = { batch_students_line, batch_faculty_line };
+    for (int f=0;f<2 && !failed;f++) {
+        if (!use[f]) continue;
+        if (batch_pass_file(files[f], &bp, tmp[f], fns[f]) < 0) { failed = 1; break; }
+        close(bp.fd_out);
+        changed[f] = bp.changed;
+    }
+    for (int k=0;k<bp.n;k++)
+        if (!op[k].err && !op[k].seen)
+            op[k].err = op[k].kind == OP_UPD_FAC ? "no such faculty" : "no such student";
+
+    if (need_enr && !failed) {
+        if (batch_pass_file(ENR_FILE, &bp, tmp[2], batch_enr_line) < 0) failed = 1;
+        else {
+            // Courses with no enrollment line yet
+            for (int k=0;k<bp.n;k++) {
+                if (!is_enroll_op(&op[k]) || op[k].applied || op[k].err) continue;
+                char list[BUF_SIZE] = "";
+                batch_apply_course(&bp, op[k].cid, list, sizeof(list));
+                batch_write_course(&bp, op[k].cid, list);
+                bp.changed = 1;
+            }
+            close(bp.fd_out);
+            changed[2] = bp.changed;
+        }
+    }
+
+    for (int k=0;k<bp.n && !failed;k++) if (op[k].err) failed = 1;
+
+    // Timetable in submission order, so "unenroll A; enroll B" frees A first.
+    // Students the index cannot hold are checked against the batch's own
+    // enrollments temp file, i.e. the state the batch would commit.
+    for (int k=0;k<bp.n && !failed;k++) {
+        batch_op *o = &op[k];
+        if (o->kind == OP_UNENROLL) { tt_unbook(o->id, o->cid); o->booked = 1; }
+        if (o->kind != OP_ENROLL) continue;
+        tt_iv clash;
+        int b = tt_book(o->id, o->cid, o->slot, o->nslots, &clash);
+        if (b < 0) b = tt_scan(tmp[2], o->id, o->cid, o->slot, o->nslots, &clash);
+        else if (!b) o->booked = 1;
+        if (b) {
+            o->err = "timetable clash with";
+            snprintf(o->clash, sizeof(o->clash), "%s", clash.cid);
+            failed = 1;
+        }
+    }
+
+    // Commit: every temp file is complete before the first rename.
+    // enrollments.txt goes first, since it must match the timetable: if it
+    // (or the first file at all) cannot be replaced nothing has changed and
+    // the batch fails. A later failure can only leave a user file
+    // (students.txt/faculty.txt) behind; that is reported as partial.
+    static const int order[3] = { 2, 0, 1 };
+    char missed[BUF_SIZE] = "";
+    int renamed = 0;
+    for (int i=0;i<3;i++) {
+        int f = order[i];
+        if (!tmp[f][0]) continue;
+        if (!failed && changed[f]) {
+            if (!rename(tmp[f], files[f])) { renamed = 1; continue; }
+            perror("rename");
+            if (!renamed) failed = 1;
+            snprintf(missed + strlen(missed), sizeof(missed) - strlen(missed), " %s", files[f]);
+        }
+        unlink(tmp[f]);
+    }
+    if (failed) {
+        // Undo timetable bookings made while applying, newest first
+        for (int k=bp.n-1;k>=0;k--) {
+            if (!op[k].booked) continue;
+            if (op[k].kind == OP_ENROLL) tt_unbook(op[k].id, op[k].cid);
+            else tt_book(op[k].id, op[k].cid, op[k].slot, op[k].nslots, NULL);
+        }
+    }
+    unlock_data();
+
+    for (int k=0, shown=0;k<bp.n && shown<20;k++) {
+        if (!op[k].err) continue;
+        snprintf(out, sizeof(out), "line %d (%s): %s%s%s\n", op[k].line, op[k].id, op[k].err,
+                 op[k].clash[0] ? " " : "", op[k].clash);
+        send_str(cfd, out);
+        shown++;
+    }
+    if (missed[0]) {
+        snprintf(out, sizeof(out), "Could not replace%s.\n", missed);
+        send_str(cfd, out);
+    }
+    if (failed) send_str(cfd, "Batch rejected, nothing applied.\n");
+    else {
+        for (int k=0;k<bp.n;k++) if (is_enroll_op(&op[k])) notify_course(op[k].cid);
+        snprintf(out, sizeof(out), missed[0] ? "Batch partly committed: %d ops, user updates in the"
+                                               " files above were not applied.\n"
+                                             : "Batch committed: %d ops.\n", bp.n);
+        send_str(cfd, out);
+    }
+    free(op);
+}
+
 
 void handle_client(int cfd) {
-    char buf[BUF_SIZE], name[50], id[50], pwd[50];
+    char buf[BUF_SIZE], name[BUF_SIZE], id[BUF_SIZE], pwd[BUF_SIZE];
 
+    watch_init_session();
     while (1) {
         // Main menu
         send_str(cfd,
@@ -279,7 +1700,8 @@ void handle_client(int cfd) {
                 auth = (!strcmp(name,"admin") && !strcmp(pwd,"admin123"));
                 if (auth) strcpy(id,"admin");
             } else {
-                auth = authenticate(role==2?FAC_FILE:STUD_FILE, name,pwd, role==3);
+                auth = authenticate(role==2?FAC_FILE:STUD_FILE, name,pwd, role==3, cfd);
+                if (auth<0) { send_str(cfd,"Server busy, try again.\n"); auth=0; continue; }
                 if (auth) find_id_by_name(role==2?FAC_FILE:STUD_FILE,name,id);
             }
             if (!auth) send_str(cfd,"Auth failed.\n");
@@ -291,7 +1713,7 @@ void handle_client(int cfd) {
             if (role==1) {
                 send_str(cfd,
                   "[Admin]\n"
-                  "1)AddStu 2)AddFac 3)ToggleStu 4)UpdUser 5)Logout\n"
+                  "1)AddStu 2)AddFac 3)ToggleStu 4)UpdUser 5)Logout 6)HashStats 7)Batch\n"
                   "Choice: ");
                 read_line(cfd,buf,sizeof(buf)); trim(buf);
                 if (buf[0]=='5') break;
@@ -299,8 +1721,10 @@ void handle_client(int cfd) {
                     send_str(cfd,"sid,name,pwd: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
                     char *s=strtok(buf,","),*n=strtok(NULL,","),*p=strtok(NULL,",");
-                    char rec[BUF_SIZE];
-                    snprintf(rec,sizeof(rec),"%s:%s:%s:active",s,n,p);
+                    char rec[BUF_SIZE], h[BUF_SIZE];
+                    if (!p) { send_str(cfd,"Invalid\n"); continue; }
+                    if (hash_password(p,h,sizeof(h))<0) { send_str(cfd,"Server busy, try again.\n"); continue; }
+                    snprintf(rec,sizeof(rec),"%s:%s:%s:active",s,n,h);
                     append_line_sys(STUD_FILE, rec);
                     send_str(cfd,"Student added.\n");
                 }
@@ -308,8 +1732,10 @@ void handle_client(int cfd) {
                     send_str(cfd,"fid,name,pwd: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
                     char *f_=strtok(buf,","),*n=strtok(NULL,","),*p=strtok(NULL,",");
-                    char rec[BUF_SIZE];
-                    snprintf(rec,sizeof(rec),"%s:%s:%s",f_,n,p);
+                    char rec[BUF_SIZE], h[BUF_SIZE];
+                    if (!p) { send_str(cfd,"Invalid\n"); continue; }
+                    if (hash_password(p,h,sizeof(h))<0) { send_str(cfd,"Server busy, try again.\n"); continue; }
+                    snprintf(rec,sizeof(rec),"%s:%s:%s",f_,n,h);
                     append_line_sys(FAC_FILE, rec);
                     send_str(cfd,"Faculty added.\n");
                 }
@@ -322,28 +1748,41 @@ void handle_client(int cfd) {
                     send_str(cfd,"type(student/faculty),id,name,pwd: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
                     char *t=strtok(buf,","),*u=strtok(NULL,","),*n=strtok(NULL,","),*p=strtok(NULL,",");
-                    char rec[BUF_SIZE];
+                    char rec[BUF_SIZE], h[BUF_SIZE];
+                    if (!p) { send_str(cfd,"Invalid\n"); continue; }
+                    if (hash_password(p,h,sizeof(h))<0) { send_str(cfd,"Server busy, try again.\n"); continue; }
                     if (!strcmp(t,"student"))
-                        snprintf(rec,sizeof(rec),"%s:%s:%s:active",u,n,p);
+                        snprintf(rec,sizeof(rec),"%s:%s:%s:active",u,n,h);
                     else
-                        snprintf(rec,sizeof(rec),"%s:%s:%s",u,n,p);
+                        snprintf(rec,sizeof(rec),"%s:%s:%s",u,n,h);
                     rewrite_single_line_sys(!strcmp(t,"student")?STUD_FILE:FAC_FILE, u, rec, cfd);
                     send_str(cfd,"User updated.\n");
                 }
+                else if (buf[0]=='6') {
+                    send_hash_stats(cfd);
+                }
+                else if (buf[0]=='7') {
+                    run_batch(cfd);
+                }
                 else send_str(cfd,"Invalid\n");
             }
 
             else if (role==2) {
                 send_str(cfd,
                   "[Faculty]\n"
-                  "1)AddCourse 2)RemCourse 3)ViewEnroll 4)ChPwd 5)Logout\n"
+                  "1)AddCourse 2)RemCourse 3)ViewEnroll 4)ChPwd 5)Logout 6)Clashes\n"
                   "Choice: ");
                 read_line(cfd,buf,sizeof(buf)); trim(buf);
                 if (buf[0]=='5') break;
                 if (buf[0]=='1') {
-                    send_str(cfd,"cid,name,maxSeats: ");
+                    send_str(cfd,"cid,name,maxSeats[,slots e.g. MON0900-1030;WED0900-1030]: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
-                    char *c=strtok(buf,","),*n=strtok(NULL,","),*m=strtok(NULL,",");
+                    char *c=strtok(buf,","),*n=strtok(NULL,","),*m=strtok(NULL,","),*sl=strtok(NULL,",");
+                    tt_iv iv[SLOTS_MAX];
+                    if (sl && parse_slots(sl, iv, SLOTS_MAX) < 0) {
+                        send_str(cfd,"Invalid slots (use DAYhhmm-hhmm;...).\n");
+                        continue;
+                    }
                     
                     // Inform the faculty that they need to wait
                     char wait_msg[BUF_SIZE];
@@ -356,14 +1795,19 @@ void handle_client(int cfd) {
                     sleep(COURSE_ADD_DELAY);
                     
                     char rec[BUF_SIZE];
-                    snprintf(rec,sizeof(rec),"%s:%s:%s:%s",c,n,id,m);
+                    if (sl) snprintf(rec,sizeof(rec),"%s:%s:%s:%s:%s",c,n,id,m,sl);
+                    else    snprintf(rec,sizeof(rec),"%s:%s:%s:%s",c,n,id,m);
                     append_line_sys(CRS_FILE, rec);
                     send_str(cfd,"Course added.\n");
                 }
                 else if (buf[0]=='2') {
                     send_str(cfd,"cid to remove: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
-                    rewrite_single_line_sys(CRS_FILE, buf, "", cfd);
+                    lock_data();                  // file and index change together
+                    int gone = rewrite_single_line_sys(CRS_FILE, buf, "", cfd);
+                    if (gone) tt_drop_course(buf);
+                    unlock_data();
+                    if (gone) notify_course(buf);
                     send_str(cfd,"Course removed.\n");
                 }
                 else if (buf[0]=='3') {
@@ -414,38 +1858,46 @@ void handle_client(int cfd) {
                 else if (buf[0]=='4') {
                     send_str(cfd,"new pwd: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
-                    char rec[BUF_SIZE];
-                    snprintf(rec,sizeof(rec),"%s::%s",id,buf);
-                    rewrite_single_line_sys(FAC_FILE,id,rec,cfd);
+                    char h[BUF_SIZE];
+                    if (hash_password(buf,h,sizeof(h))<0) { send_str(cfd,"Server busy, try again.\n"); continue; }
+                    set_password_sys(FAC_FILE,id,NULL,h,cfd);
                     send_str(cfd,"Password changed.\n");
                 }
+                else if (buf[0]=='6') {
+                    send_clash_report(cfd, id);
+                }
                 else send_str(cfd,"Invalid\n");
             }
 
             else {  // Student menu
                 send_str(cfd,
                   "[Student]\n"
-                  "1)Enroll 2)Unenroll 3)View 4)ChPwd 5)Logout\n"
+                  "1)Enroll 2)Unenroll 3)View 4)ChPwd 5)Logout 6)Watch\n"
                   "Choice: ");
                 read_line(cfd,buf,sizeof(buf)); trim(buf);
-                if (buf[0]=='5') break;
+                if (buf[0]=='5') { watch_release_all(); break; }
 
                 if (buf[0]=='1') {
                     send_str(cfd,"Enter courseID to enroll: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
                     char *cid = buf;
                     
+                    // Seat count and enrollment list must not change until rename
+                    lock_data();
+
                     // Check if course exists
                     FILE *cf = fopen(CRS_FILE, "r");
                     char cline[BUF_SIZE];
                     int course_found = 0;
                     int max_seats = 0;
+                    tt_iv slots[SLOTS_MAX];
+                    int nslots = 0;
                     
                     while (cf && fgets(cline, sizeof(cline), cf)) {
                         trim(cline);
-                        char *fld[4], *p = cline; 
+                        char *fld[5] = {0}, *p = cline; 
                         int i = 0;
-                        while (i < 4 && p) { 
+                        while (i < 5 && p) { 
                             fld[i++] = p; 
                             p = strchr(p, ':'); 
                             if(p) *p++ = '\0'; 
@@ -454,12 +1906,14 @@ void handle_client(int cfd) {
                         if (strcmp(fld[0], cid) == 0) {
                             course_found = 1;
                             max_seats = atoi(fld[3]);
+                            if (fld[4] && *fld[4]) nslots = parse_slots(fld[4], slots, SLOTS_MAX);
                             break;
                         }
                     }
                     if (cf) fclose(cf);
                     
                     if (!course_found) {
+                        unlock_data();
                         send_str(cfd, "Course not found.\n");
                         continue;
                     }
@@ -467,9 +1921,23 @@ void handle_client(int cfd) {
                     // Check enrollment count
                     int current_enrollment = count_enroll_sys(cid);
                     if (current_enrollment >= max_seats) {
+                        unlock_data();
                         send_str(cfd, "Course is full.\n");
                         continue;
                     }
+
+                    // Reserve the meeting slots; a no-op if already enrolled
+                    tt_iv clash;
+                    int booked = tt_book(id, cid, slots, nslots, &clash);
+                    if (booked < 0) booked = tt_scan(ENR_FILE, id, cid, slots, nslots, &clash);
+                    if (booked > 0) {
+                        unlock_data();
+                        char msg[BUF_SIZE], when[32];
+                        format_slot(&clash, when, sizeof(when));
+                        snprintf(msg, sizeof(msg), "Timetable clash with course %s (%s).\n", clash.cid, when);
+                        send_str(cfd, msg);
+                        continue;
+                    }
                     
                     // rewrite ENR_FILE
                     int in = open(ENR_FILE,O_RDONLY);
@@ -480,7 +1948,7 @@ void handle_client(int cfd) {
 
                     char line2[BUF_SIZE];
                     size_t len2=0; ssize_t r2;
-                    int found=0;
+                    int found=0, already=0;
                     while ((r2=read(in,line2+len2,1))==1) {
                         len2++;
                         if (line2[len2-1]=='\n' || len2==BUF_SIZE-1) {
@@ -490,22 +1958,18 @@ void handle_client(int cfd) {
                                 // parse existing list
                                 char *rest = line2 + strlen(cid) + 1;
                                 int dup=0;
-                                char copy[BUF_SIZE]; strcpy(copy,rest);
+                                char copy[BUF_SIZE]; strcpy(copy,rest); trim(copy);
                                 for (char *p=strtok(copy,"," ); p; p=strtok(NULL,"," )) {
                                     if (!strcmp(p,id)) { dup=1; break; }
                                 }
                                 if (dup) {
                                     write(fd_tmp,line2,len2);
-                                    close(in);
-                                    close(fd_tmp);
-                                    rename(tmp,ENR_FILE);
-                                    send_str(cfd,"Already enrolled.\n");
-                                    continue;
+                                    already=1;
                                 }
                                 else {
                                     write(fd_tmp,cid,strlen(cid));
                                     write(fd_tmp,":",1);
-                                    write(fd_tmp,rest,strlen(rest));
+                                    write(fd_tmp,rest,strcspn(rest,"\r\n"));
                                     write(fd_tmp,",",1);
                                     write(fd_tmp,id,strlen(id));
                                     write(fd_tmp,"\n",1);
@@ -524,7 +1988,16 @@ void handle_client(int cfd) {
                     }
                     close(in);
                     close(fd_tmp);
+                    if (already) {
+                        // Keep scanning to the end so the file is left untouched
+                        unlink(tmp);
+                        unlock_data();
+                        send_str(cfd,"Already enrolled.\n");
+                        continue;
+                    }
                     rename(tmp,ENR_FILE);
+                    unlock_data();
+                    notify_course(cid);
                     send_str(cfd,"Enrolled.\n");
                     // After successfully enrolling:
                     send_str(cfd, "Enrolled in course ");
@@ -535,6 +2008,7 @@ void handle_client(int cfd) {
                     send_str(cfd,"Enter courseID to unenroll: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
                     char *cid = buf;
+                    lock_data();
                     int in = open(ENR_FILE,O_RDONLY);
                     char tmp[]="./tmp_enrXXXXXX"; // Use current directory instead of /tmp
                     int fd_tmp=mkstemp(tmp);
@@ -543,6 +2017,7 @@ void handle_client(int cfd) {
 
                     char line2[BUF_SIZE];
                     size_t len2=0; ssize_t r2;
+                    int removed=0;
                     while ((r2=read(in,line2+len2,1))==1) {
                         len2++;
                         if (line2[len2-1]=='\n' || len2==BUF_SIZE-1) {
@@ -551,13 +2026,13 @@ void handle_client(int cfd) {
                                 char *rest = line2 + strlen(cid) + 1;
                                 char kept[BUF_SIZE] = "";
                                 int first=1;
-                                char copy[BUF_SIZE]; strcpy(copy,rest);
+                                char copy[BUF_SIZE]; strcpy(copy,rest); trim(copy);
                                 for (char *p=strtok(copy,"," ); p; p=strtok(NULL,"," )) {
                                     if (strcmp(p,id)) {
                                         if (!first) strcat(kept,",");
                                         strcat(kept,p);
                                         first=0;
-                                    }
+                                    } else removed=1;
                                 }
                                 if (kept[0]) {
                                     write(fd_tmp,cid,strlen(cid));
@@ -574,6 +2049,9 @@ void handle_client(int cfd) {
                     close(in);
                     close(fd_tmp);
                     rename(tmp,ENR_FILE);
+                    if (removed) tt_unbook(id, cid);   // before another writer can look
+                    unlock_data();
+                    if (removed) notify_course(cid);
                     send_str(cfd,"Unenrolled.\n");
                 }
                 else if (buf[0]=='3') {
@@ -631,15 +2109,19 @@ void handle_client(int cfd) {
                                         while (cf && fgets(cline, sizeof(cline), cf)) {
                                             trim(cline);
                                             if (strncmp(cline, cid, strlen(cid)) == 0 && cline[strlen(cid)] == ':') {
-                                                char *fields[4], *c = cline;
+                                                char *fields[5] = {0}, *c = cline;
                                                 int i = 0;
-                                                while (i < 4 && c) {
+                                                while (i < 5 && c) {
                                                     fields[i++] = c;
                                                     c = strchr(c, ':');
                                                     if (c) *c++ = '\0';
                                                 }
                                                 
-                                                if (i >= 2) {
+                                                if (i >= 5 && *fields[4]) {
+                                                    snprintf(course_info, sizeof(course_info), 
+                                                             "Course ID: %s, Name: %s, Slots: %s\n", fields[0], fields[1], fields[4]);
+                                                }
+                                                else if (i >= 2) {
                                                     snprintf(course_info, sizeof(course_info), 
                                                              "Course ID: %s, Name: %s\n", fields[0], fields[1]);
                                                 }
@@ -672,31 +2154,26 @@ void handle_client(int cfd) {
                 else if (buf[0]=='4') {
                     send_str(cfd,"Enter new password: ");
                     read_line(cfd,buf,sizeof(buf)); trim(buf);
-                    // read existing name,status
-                    FILE *sf = fopen(STUD_FILE,"r");
-                    char tmpb[BUF_SIZE], nm[BUF_SIZE]={0}, st[BUF_SIZE]="active";
-                    while (fgets(tmpb,sizeof(tmpb),sf)) {
-                        trim(tmpb);
-                        if (!strncmp(tmpb,id,strlen(id)) && tmpb[strlen(id)]==':') {
-                            char *fld[4], *p2=tmpb; int j=0;
-                            while (j<4 && p2) { fld[j++]=p2; p2=strchr(p2,':'); if (p2)*p2++ = '\0'; }
-                            strcpy(nm,fld[1]);
-                            strcpy(st,fld[3]);
-                            break;
-                        }
-                    }
-                    fclose(sf);
-                    char rec[BUF_SIZE];
-                    snprintf(rec,sizeof(rec),"%s:%s:%s:%s",id,nm,buf,st);
-                    rewrite_single_line_sys(STUD_FILE,id,rec,cfd);
+                    char h[BUF_SIZE];
+                    if (hash_password(buf,h,sizeof(h))<0) { send_str(cfd,"Server busy, try again.\n"); continue; }
+                    // name and status are re-read at write time, not before hashing
+                    set_password_sys(STUD_FILE,id,NULL,h,cfd);
                     send_str(cfd,"Password changed.\n");
                 }
+                else if (buf[0]=='6') {
+                    send_str(cfd,"Enter courseID to watch/unwatch: ");
+                    read_line(cfd,buf,sizeof(buf)); trim(buf);
+                    if (course_max_seats(buf) < 0) { send_str(cfd,"Course not found.\n"); continue; }
+                    int w = watch_toggle(buf);
+                    if (w < 0) send_str(cfd,"Too many watches, try again later.\n");
+                    else send_str(cfd, w ? "Watching course; seat changes will be pushed.\n"
+                                         : "Stopped watching course.\n");
+                }
                 else send_str(cfd,"Invalid\n");
             }
         }
     }
-    close(cfd);
-    exit(0);
+    end_session(cfd);
 }
 
 int main(){
@@ -705,6 +2182,13 @@ int main(){
     open(FAC_FILE,  O_CREAT,0644);
     open(CRS_FILE,  O_CREAT,0644);
     open(ENR_FILE,  O_CREAT,0644);
+    open(LOCK_FILE, O_CREAT,0644);
+    signal(SIGPIPE, SIG_IGN);     // a dropped client shows up as EOF in read_line
+
+    // Hash workers are forked before any client so they share the job queue
+    if (start_hash_pool() < 0) return 1;
+    if (start_watch_table() < 0) return 1;
+    if (start_timetable() < 0) return 1;
 
     int sfd = socket(AF_INET,SOCK_STREAM,0);
     struct sockaddr_in sa = {
@@ -723,7 +2207,16 @@ int main(){
             handle_client(cfd);
         }
         close(cfd);
-        waitpid(-1,NULL,WNOHANG);
+        // Free a finished session's watches while it is still a zombie,
+        // then reap it; a dead hash worker is replaced
+        while (1) {
+            siginfo_t si;
+            memset(&si, 0, sizeof(si));
+            if (waitid(P_ALL, 0, &si, WEXITED|WNOHANG|WNOWAIT) < 0 || !si.si_pid) break;
+            watch_release_pid(si.si_pid);
+            waitpid(si.si_pid, NULL, 0);
+            hash_worker_exited(si.si_pid, sfd);
+        }
     }
     return 0;
 }